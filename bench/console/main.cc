@@ -0,0 +1,544 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2024 Kernkonzept GmbH.
+ */
+
+/*
+ * Throughput and latency benchmark for Console::Device.
+ *
+ * A sink device based on L4virtio::Svr::Console::Device runs in a second
+ * thread of the same task and discards all data it receives. A minimal
+ * driver in the main thread brings up the ports through the control queue
+ * and writes buffers of different sizes to the transmit queues of the
+ * ports. It measures
+ *
+ * - "stream": all ports are written round robin, keeping their queues
+ *   filled, and the driver only waits when no descriptor is free,
+ * - "pingpong": one buffer on port 0 at a time, waiting for its completion,
+ *
+ * for different numbers of ports and queue sizes. Besides the data rate,
+ * the number of notifications sent to the device (kicks) and received from
+ * the device (IRQs) per MiB of data is reported.
+ *
+ * Results are printed as CSV, one line per measurement:
+ *
+ *   mode,ports,queue_size,write_size,writes,bytes,elapsed_us,bytes_per_s,
+ *   ns_per_write,kicks_per_mib,irqs_per_mib
+ *
+ * Usage: l4virtio-bench-console [MiB per stream measurement]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <pthread.h>
+#include <pthread-l4.h>
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/br_manager>
+#include <l4/re/util/object_registry>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <l4/l4virtio/client/l4virtio>
+#include <l4/l4virtio/server/virtio-console-device>
+
+namespace {
+
+using L4virtio::Driver::Virtqueue;
+using L4virtio::Svr::Console::Control_message;
+
+enum
+{
+  Max_queue_size = 256,
+  Max_write = 4096,
+  Ctrl_queue_size = 16,
+  Ctrl_buf_size = 64,
+  Default_mib = 4,
+  Pingpong_writes = 10000,
+};
+
+unsigned const port_counts[] = { 1, 4, 16, 64 };
+unsigned const queue_sizes[] = { 16, 64, 256 };
+unsigned const write_sizes[] = { 1, 16, 64, 256, 1024, 4096 };
+
+enum
+{
+  Num_port_counts = sizeof(port_counts) / sizeof(port_counts[0]),
+  Num_queue_sizes = sizeof(queue_sizes) / sizeof(queue_sizes[0]),
+};
+
+/**
+ * Console device discarding all data written by the driver.
+ */
+class Sink
+: public L4virtio::Svr::Console::Device,
+  public L4::Epiface_t<Sink, L4virtio::Device>
+{
+public:
+  explicit Sink(unsigned ports) : Device(Max_queue_size, ports)
+  { init_mem_info(2); }
+
+  L4::Cap<void> register_obj(L4::Registry_iface *registry)
+  {
+    L4Re::chkcap(registry->register_irq_obj(irq_iface()),
+                 "Register notification IRQ");
+    return L4Re::chkcap(registry->register_obj(this),
+                        "Register console sink");
+  }
+
+  void rx_data_available(unsigned port) override
+  {
+    unsigned len;
+    while (port_read_peek(&len, port))
+      port_read_commit(len, port);
+  }
+
+  void tx_space_available(unsigned) override
+  {}
+
+protected:
+  L4::Ipc_svr::Server_iface *server_iface() const override
+  { return this->L4::Epiface::server_iface(); }
+};
+
+/**
+ * Driver writing to the ports of a multiport console.
+ */
+class Producer : public L4virtio::Driver::Device
+{
+public:
+  struct Stats
+  {
+    l4_uint64_t kicks = 0; ///< Notifications sent to the device.
+    l4_uint64_t irqs = 0;  ///< Notifications received from the device.
+  };
+
+  /**
+   * Connect to the device and open `ports` ports with queues of `qsize`
+   * entries.
+   */
+  void setup(L4::Cap<L4virtio::Device> srvcap, unsigned ports, unsigned qsize)
+  {
+    driver_connect(srvcap);
+
+    if (_config->device != L4VIRTIO_ID_CONSOLE)
+      L4Re::chksys(-L4_ENODEV, "Device is not a console device.");
+
+    L4virtio::Svr::Console::Features hf(_config->dev_features_map[0]);
+    if (!hf.console_multiport())
+      L4Re::chksys(-L4_ENODEV, "Console without multiport support.");
+
+    if (_config->num_queues < 2 * ports + 2)
+      L4Re::chksys(-L4_EINVAL, "Device has too few ports.");
+
+    for (unsigned p = 0; p < ports; ++p)
+      if (max_queue_size(tx_queue(p)) < static_cast<int>(qsize))
+        L4Re::chksys(-L4_EINVAL, "Queue size not supported by device.");
+
+    _ports = ports;
+    _txq = std::vector<Virtqueue>(ports);
+
+    // Control queues, the transmit queues of the ports, control buffers and
+    // one payload buffer shared by all data descriptors. The device only
+    // reads the payload, so its content does not matter.
+    l4_size_t ctrl_rx_off = 0;
+    l4_size_t ctrl_tx_off = queue_end(ctrl_rx_off, Ctrl_queue_size);
+    l4_size_t off = queue_end(ctrl_tx_off, Ctrl_queue_size);
+    std::vector<l4_size_t> txq_off(ports);
+    for (unsigned p = 0; p < ports; ++p)
+      {
+        txq_off[p] = off;
+        off = queue_end(off, qsize);
+      }
+    l4_size_t ctrl_rx_buf_off = off;
+    l4_size_t ctrl_tx_buf_off = ctrl_rx_buf_off
+                                + Ctrl_queue_size * Ctrl_buf_size;
+    l4_size_t payload_off = ctrl_tx_buf_off + Ctrl_queue_size * Ctrl_buf_size;
+    l4_size_t totalsz = l4_round_page(payload_off + Max_write);
+
+    _ds = L4Re::chkcap(L4Re::Util::make_unique_cap<L4Re::Dataspace>(),
+                       "Allocate queue dataspace capability");
+    auto *e = L4Re::Env::env();
+    L4Re::chksys(e->mem_alloc()->alloc(totalsz, _ds.get()),
+                 "Allocate memory for virtio structures");
+    L4Re::chksys(e->rm()->attach(&_region, totalsz,
+                                 L4Re::Rm::F::Search_addr | L4Re::Rm::F::RW,
+                                 L4::Ipc::make_cap_rw(_ds.get()), 0,
+                                 L4_PAGESHIFT),
+                 "Attach dataspace for virtio structures");
+
+    l4_uint64_t devaddr;
+    L4Re::chksys(register_ds(_ds.get(), 0, totalsz, &devaddr),
+                 "Register queue dataspace with device");
+
+    init_queue(&_ctrl_rx, 2, Ctrl_queue_size, devaddr, ctrl_rx_off);
+    init_queue(&_ctrl_tx, 3, Ctrl_queue_size, devaddr, ctrl_tx_off);
+    for (unsigned p = 0; p < ports; ++p)
+      init_queue(&_txq[p], tx_queue(p), qsize, devaddr, txq_off[p]);
+
+    _ctrl_bufs = _region.get() + ctrl_rx_buf_off;
+    _ctrl_tx_bufs = _region.get() + ctrl_tx_buf_off;
+    for (l4_uint16_t d = 0; d < Ctrl_queue_size; ++d)
+      {
+        auto &rx = _ctrl_rx.desc(d);
+        rx.addr = L4virtio::Ptr<void>(devaddr + ctrl_rx_buf_off
+                                      + d * Ctrl_buf_size);
+        rx.len = Ctrl_buf_size;
+        rx.flags.raw = 0;
+        rx.flags.write() = 1;
+
+        auto &tx = _ctrl_tx.desc(d);
+        tx.addr = L4virtio::Ptr<void>(devaddr + ctrl_tx_buf_off
+                                      + d * Ctrl_buf_size);
+        tx.len = sizeof(Control_message);
+        tx.flags.raw = 0;
+      }
+
+    memset(_region.get() + payload_off, 'x', Max_write);
+    for (unsigned p = 0; p < ports; ++p)
+      for (l4_uint16_t d = 0; d < qsize; ++d)
+        {
+          auto &desc = _txq[p].desc(d);
+          desc.addr = L4virtio::Ptr<void>(devaddr + payload_off);
+          desc.flags.raw = 0;
+        }
+
+    L4virtio::Svr::Console::Features df(0);
+    df.console_multiport() = 1;
+    _config->driver_features_map[0] = df.raw;
+    l4virtio_set_feature(_config->driver_features_map,
+                         L4VIRTIO_FEATURE_VERSION_1);
+    L4Re::chksys(driver_acknowledge(), "Acknowledge device");
+
+    open_ports();
+    count_pending_irqs();
+    reset_stats();
+  }
+
+  /**
+   * Write `num` buffers of `size` bytes, round robin over all ports.
+   *
+   * Every round fills the free descriptors of each port and notifies the
+   * device once per port. The function returns when the device has
+   * consumed all buffers.
+   */
+  void stream(unsigned size, unsigned num)
+  {
+    while (num)
+      {
+        for (unsigned p = 0; p < _ports && num; ++p)
+          {
+            Virtqueue &q = _txq[p];
+            unsigned n = 0;
+            l4_uint16_t d;
+            while (n < num && (d = q.alloc_descriptor()) != Virtqueue::Eoq)
+              {
+                q.desc(d).len = size;
+                q.enqueue_descriptor(d);
+                ++n;
+              }
+
+            if (n)
+              {
+                num -= n;
+                _inflight += n;
+                kick(q);
+              }
+          }
+
+        if (num && !reclaim())
+          wait_irq();
+      }
+
+    while (_inflight)
+      if (!reclaim())
+        wait_irq();
+
+    count_pending_irqs();
+  }
+
+  /**
+   * Write `num` buffers of `size` bytes to port 0, one at a time.
+   */
+  void ping_pong(unsigned size, unsigned num)
+  {
+    Virtqueue &q = _txq[0];
+    for (unsigned i = 0; i < num; ++i)
+      {
+        l4_uint16_t d = q.alloc_descriptor();
+        q.desc(d).len = size;
+        q.enqueue_descriptor(d);
+        kick(q);
+
+        l4_uint16_t used;
+        while ((used = q.find_next_used()) == Virtqueue::Eoq)
+          wait_irq();
+
+        q.free_descriptor(used, used);
+      }
+
+    count_pending_irqs();
+  }
+
+  Stats const &stats() const
+  { return _stats; }
+
+  void reset_stats()
+  { _stats = Stats(); }
+
+private:
+  /// Return the index of the transmit queue of a port.
+  static unsigned tx_queue(unsigned port)
+  { return port == 0 ? 1 : 2 * port + 3; }
+
+  static l4_size_t queue_end(l4_size_t off, unsigned num)
+  {
+    return l4_round_size(off + Virtqueue::total_size(num),
+                         L4virtio::Virtqueue::Desc_align);
+  }
+
+  void init_queue(Virtqueue *q, unsigned idx, unsigned num,
+                  l4_uint64_t devaddr, l4_size_t off)
+  {
+    q->init_queue(num, _region.get() + off);
+    L4Re::chksys(config_queue(idx, num, devaddr + off,
+                              devaddr + off + q->avail_offset(),
+                              devaddr + off + q->used_offset()),
+                 "Configure queue");
+  }
+
+  void kick(Virtqueue &q)
+  {
+    if (!q.no_notify_host())
+      ++_stats.kicks;
+    notify(q);
+  }
+
+  void wait_irq()
+  {
+    L4Re::chksys(wait(0), "Wait for device notification");
+    ++_stats.irqs;
+  }
+
+  /**
+   * Count the notifications that were sent by the device but not waited
+   * for. A notification still in flight is accounted to the next
+   * measurement.
+   */
+  void count_pending_irqs()
+  {
+    while (!l4_ipc_error(_driver_notification->down(L4_IPC_BOTH_TIMEOUT_0),
+                         l4_utcb()))
+      ++_stats.irqs;
+  }
+
+  /// Return the finished descriptors of all ports to the free lists.
+  unsigned reclaim()
+  {
+    unsigned n = 0;
+    for (unsigned p = 0; p < _ports; ++p)
+      {
+        l4_uint16_t d;
+        while ((d = _txq[p].find_next_used()) != Virtqueue::Eoq)
+          {
+            _txq[p].free_descriptor(d, d);
+            ++n;
+          }
+      }
+
+    _inflight -= n;
+    return n;
+  }
+
+  void send_ctrl(l4_uint32_t id, l4_uint16_t event, l4_uint16_t value)
+  {
+    l4_uint16_t d;
+    while ((d = _ctrl_tx.alloc_descriptor()) == Virtqueue::Eoq)
+      {
+        l4_uint16_t used;
+        bool found = false;
+        while ((used = _ctrl_tx.find_next_used()) != Virtqueue::Eoq)
+          {
+            _ctrl_tx.free_descriptor(used, used);
+            found = true;
+          }
+
+        if (!found)
+          wait_irq();
+      }
+
+    Control_message msg(id, event, value);
+    memcpy(_ctrl_tx_bufs + d * Ctrl_buf_size, &msg, sizeof(msg));
+    send(_ctrl_tx, d);
+  }
+
+  /**
+   * Run the control queue protocol until the device opened all ports.
+   */
+  void open_ports()
+  {
+    l4_uint16_t d;
+    while ((d = _ctrl_rx.alloc_descriptor()) != Virtqueue::Eoq)
+      _ctrl_rx.enqueue_descriptor(d);
+    notify(_ctrl_rx);
+
+    send_ctrl(0, Control_message::Device_ready, 1);
+
+    unsigned open = 0;
+    while (open < _ports)
+      {
+        l4_uint32_t len;
+        unsigned n = 0;
+        while ((d = _ctrl_rx.find_next_used(&len)) != Virtqueue::Eoq)
+          {
+            Control_message msg;
+            memcpy(&msg, _ctrl_bufs + d * Ctrl_buf_size, sizeof(msg));
+            _ctrl_rx.enqueue_descriptor(d);
+            ++n;
+
+            if (len < sizeof(msg) || msg.id >= _ports)
+              continue;
+
+            if (msg.event == Control_message::Device_add)
+              send_ctrl(msg.id, Control_message::Port_ready, 1);
+            else if (msg.event == Control_message::Port_open && msg.value)
+              ++open;
+          }
+
+        // Returning the buffers also lets the device retry port reports
+        // that failed for lack of buffers.
+        if (n)
+          notify(_ctrl_rx);
+        else
+          wait_irq();
+      }
+  }
+
+  unsigned _ports = 0;
+  unsigned _inflight = 0;
+  Stats _stats;
+  Virtqueue _ctrl_rx, _ctrl_tx;
+  std::vector<Virtqueue> _txq;
+  L4Re::Util::Unique_cap<L4Re::Dataspace> _ds;
+  L4Re::Rm::Unique_region<char *> _region;
+  char *_ctrl_bufs = nullptr;
+  char *_ctrl_tx_bufs = nullptr;
+};
+
+struct Server_ctx
+{
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+  bool ready = false;
+  L4::Cap<L4virtio::Device> devs[Num_port_counts][Num_queue_sizes];
+};
+
+void *server_thread(void *arg)
+{
+  auto *ctx = static_cast<Server_ctx *>(arg);
+
+  static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks>
+    server(Pthread::L4::cap(pthread_self()), L4Re::Env::env()->factory());
+
+  // One device per measurement setup, so that no device reset is needed in
+  // between.
+  pthread_mutex_lock(&ctx->lock);
+  for (unsigned i = 0; i < Num_port_counts; ++i)
+    for (unsigned j = 0; j < Num_queue_sizes; ++j)
+      {
+        auto *dev = new Sink(port_counts[i]);
+        ctx->devs[i][j] = L4::cap_cast<L4virtio::Device>(
+          dev->register_obj(server.registry()));
+      }
+  ctx->ready = true;
+  pthread_cond_signal(&ctx->ready_cond);
+  pthread_mutex_unlock(&ctx->lock);
+
+  server.loop();
+  return nullptr;
+}
+
+l4_uint64_t now_us()
+{ return l4_kip_clock(l4re_kip()); }
+
+void report(char const *mode, unsigned ports, unsigned qsize, unsigned size,
+            unsigned writes, Producer::Stats const &stats, l4_uint64_t elapsed)
+{
+  if (!elapsed)
+    elapsed = 1;
+
+  l4_uint64_t bytes = l4_uint64_t{writes} * size;
+  double mib = bytes / 1048576.0;
+
+  printf("%s,%u,%u,%u,%u,%llu,%llu,%llu,%llu,%.2f,%.2f\n",
+         mode, ports, qsize, size, writes,
+         static_cast<unsigned long long>(bytes),
+         static_cast<unsigned long long>(elapsed),
+         static_cast<unsigned long long>(bytes * 1000000ULL / elapsed),
+         static_cast<unsigned long long>(elapsed * 1000ULL / writes),
+         stats.kicks / mib, stats.irqs / mib);
+}
+
+void run(L4::Cap<L4virtio::Device> dev, unsigned ports, unsigned qsize,
+         unsigned mib)
+{
+  Producer prod;
+  prod.setup(dev, ports, qsize);
+
+  for (unsigned size : write_sizes)
+    {
+      unsigned writes = (mib << 20) / size;
+
+      prod.reset_stats();
+      l4_uint64_t start = now_us();
+      prod.stream(size, writes);
+      report("stream", ports, qsize, size, writes, prod.stats(),
+             now_us() - start);
+
+      prod.reset_stats();
+      start = now_us();
+      prod.ping_pong(size, Pingpong_writes);
+      report("pingpong", ports, qsize, size, Pingpong_writes, prod.stats(),
+             now_us() - start);
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  unsigned mib = argc > 1 ? strtoul(argv[1], nullptr, 0) : 0;
+  if (!mib)
+    mib = Default_mib;
+
+  try
+    {
+      static Server_ctx ctx;
+      pthread_t th;
+      if (pthread_create(&th, nullptr, server_thread, &ctx))
+        L4Re::chksys(-L4_ENOMEM, "Create server thread");
+
+      pthread_mutex_lock(&ctx.lock);
+      while (!ctx.ready)
+        pthread_cond_wait(&ctx.ready_cond, &ctx.lock);
+      pthread_mutex_unlock(&ctx.lock);
+
+      printf("mode,ports,queue_size,write_size,writes,bytes,elapsed_us,"
+             "bytes_per_s,ns_per_write,kicks_per_mib,irqs_per_mib\n");
+
+      for (unsigned i = 0; i < Num_port_counts; ++i)
+        for (unsigned j = 0; j < Num_queue_sizes; ++j)
+          run(ctx.devs[i][j], port_counts[i], queue_sizes[j], mib);
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      fprintf(stderr, "console bench: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
@@ -0,0 +1,258 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * Copyright (C) 2024 Kernkonzept GmbH.
+ */
+
+/*
+ * Packet rate benchmark for Virtio_net_device.
+ *
+ * A loopback device based on L4virtio::Svr::Net_dev runs in a second thread
+ * of the same task and returns every frame it receives to the driver. The
+ * driver sends frames of different sizes and measures packets per second
+ * and the average time of a round trip for
+ *
+ * - the single packet API (tx(), wait_rx()) and the burst API
+ *   (tx() in a row between tx_burst_begin() and tx_burst_end(),
+ *   wait_rx_burst(), rx_refill_burst()),
+ * - interrupt driven reception (Virtio_net_device) and polling
+ *   (Virtio_net_poll_device).
+ *
+ * Results are printed as CSV, one line per measurement:
+ *
+ *   mode,api,frame_size,packets,elapsed_us,pps,round_ns
+ *
+ * `round_ns` is the average time of one round: sending and receiving one
+ * frame for the single packet API, i.e. the round trip time, and a whole
+ * burst of frames for the burst API.
+ *
+ * Usage: l4virtio-bench-net [packets]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <pthread.h>
+#include <pthread-l4.h>
+
+#include <l4/re/env>
+#include <l4/re/error_helper>
+#include <l4/re/util/br_manager>
+#include <l4/re/util/object_registry>
+#include <l4/re/env.h>
+#include <l4/sys/kip.h>
+
+#include <l4/l4virtio/client/virtio-net>
+#include <l4/l4virtio/server/virtio-net-device>
+
+namespace {
+
+enum
+{
+  Queue_size = 256,
+  Burst = 32,
+  Mtu = 9216,
+  Default_packets = 100000,
+};
+
+unsigned const frame_sizes[] = { 64, 128, 256, 512, 1024, 1514, 4096, 9216 };
+
+/**
+ * Device returning all frames sent by the driver.
+ */
+class Loopback
+: public L4virtio::Svr::Net_dev,
+  public L4::Epiface_t<Loopback, L4virtio::Device>
+{
+public:
+  Loopback() : Net_dev(Queue_size, nullptr, Mtu)
+  { init_mem_info(4); }
+
+  L4::Cap<void> register_obj(L4::Registry_iface *registry)
+  {
+    L4Re::chkcap(registry->register_irq_obj(irq_iface()),
+                 "Register notification IRQ");
+    return L4Re::chkcap(registry->register_obj(this),
+                        "Register loopback device");
+  }
+
+  bool packet_out(Tx_packet &pkt) override
+  {
+    l4virtio_net_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    // Keep the frame in the TX queue until the driver refills the RX
+    // queue, which also kicks the device.
+    return packet_in(hdr, &pkt, pkt.len()) != -L4_EAGAIN;
+  }
+
+protected:
+  L4::Ipc_svr::Server_iface *server_iface() const override
+  { return this->L4::Epiface::server_iface(); }
+};
+
+struct Server_ctx
+{
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+  bool ready = false;
+  L4::Cap<L4virtio::Device> irq_dev;
+  L4::Cap<L4virtio::Device> poll_dev;
+};
+
+void *server_thread(void *arg)
+{
+  auto *ctx = static_cast<Server_ctx *>(arg);
+
+  static L4Re::Util::Registry_server<L4Re::Util::Br_manager_hooks>
+    server(Pthread::L4::cap(pthread_self()), L4Re::Env::env()->factory());
+
+  // One device per driver, so that no device reset is needed in between.
+  static Loopback irq_dev, poll_dev;
+
+  pthread_mutex_lock(&ctx->lock);
+  ctx->irq_dev = L4::cap_cast<L4virtio::Device>(
+    irq_dev.register_obj(server.registry()));
+  ctx->poll_dev = L4::cap_cast<L4virtio::Device>(
+    poll_dev.register_obj(server.registry()));
+  ctx->ready = true;
+  pthread_cond_signal(&ctx->ready_cond);
+  pthread_mutex_unlock(&ctx->lock);
+
+  server.loop();
+  return nullptr;
+}
+
+l4_uint64_t now_us()
+{ return l4_kip_clock(l4re_kip()); }
+
+/// Queue a frame of the given size, retrying while the TX queue is full.
+void send(L4virtio::Driver::Virtio_net_device *dev, unsigned size)
+{
+  while (!dev->tx([size](L4virtio::Driver::Virtio_net_device::Packet &p)
+                    {
+                      memset(p.data, 0xff, 6);
+                      memset(p.data + 6, 0x02, 6);
+                      p.data[12] = 0x88;
+                      p.data[13] = 0xb5;
+                      return size;
+                    }))
+    ;
+}
+
+/// Receive `num` frames, blocking on the RX notification.
+void recv_irq(L4virtio::Driver::Virtio_net_device *dev, unsigned num)
+{
+  if (num == 1)
+    {
+      dev->finish_rx(dev->wait_rx());
+      dev->queue_rx();
+      return;
+    }
+
+  l4_uint16_t descs[Burst];
+
+  while (num)
+    {
+      unsigned n = dev->wait_rx_burst(descs, nullptr,
+                                      num < Burst ? num : Burst);
+      dev->rx_refill_burst(descs, n);
+      num -= n;
+    }
+}
+
+/// Receive `num` frames by polling the RX queue.
+void recv_poll(L4virtio::Driver::Virtio_net_poll_device *dev, unsigned num)
+{
+  while (num)
+    num -= dev->poll([](l4_uint16_t const *, l4_uint32_t const *, unsigned)
+                     {});
+}
+
+void report(char const *mode, char const *api, unsigned size,
+            unsigned packets, unsigned rounds, l4_uint64_t elapsed)
+{
+  if (!elapsed)
+    elapsed = 1;
+
+  printf("%s,%s,%u,%u,%llu,%llu,%llu\n", mode, api, size, packets,
+         static_cast<unsigned long long>(elapsed),
+         static_cast<unsigned long long>(packets * 1000000ULL / elapsed),
+         static_cast<unsigned long long>(elapsed * 1000ULL / rounds));
+}
+
+template<typename RECV>
+void run(char const *mode, L4virtio::Driver::Virtio_net_device *dev,
+         unsigned packets, RECV &&recv)
+{
+  for (unsigned size : frame_sizes)
+    {
+      if (size > dev->tx_data_size())
+        continue;
+
+      // Single packet: one frame in flight at a time.
+      l4_uint64_t start = now_us();
+      for (unsigned i = 0; i < packets; ++i)
+        {
+          send(dev, size);
+          recv(1);
+        }
+      report(mode, "single", size, packets, packets, now_us() - start);
+
+      // Burst: Burst frames in flight with one notification, received in
+      // batches.
+      unsigned rounds = packets / Burst;
+      start = now_us();
+      for (unsigned i = 0; i < rounds; ++i)
+        {
+          dev->tx_burst_begin();
+          for (unsigned j = 0; j < Burst; ++j)
+            send(dev, size);
+          dev->tx_burst_end();
+          recv(Burst);
+        }
+      report(mode, "burst", size, rounds * Burst, rounds, now_us() - start);
+    }
+}
+
+}
+
+int main(int argc, char **argv)
+{
+  unsigned packets = argc > 1 ? strtoul(argv[1], nullptr, 0) : 0;
+  if (packets < Burst)
+    packets = Default_packets;
+
+  try
+    {
+      static Server_ctx ctx;
+      pthread_t th;
+      if (pthread_create(&th, nullptr, server_thread, &ctx))
+        L4Re::chksys(-L4_ENOMEM, "Create server thread");
+
+      pthread_mutex_lock(&ctx.lock);
+      while (!ctx.ready)
+        pthread_cond_wait(&ctx.ready_cond, &ctx.lock);
+      pthread_mutex_unlock(&ctx.lock);
+
+      printf("mode,api,frame_size,packets,elapsed_us,pps,round_ns\n");
+
+      static L4virtio::Driver::Virtio_net_device irq_dev;
+      irq_dev.setup_device(ctx.irq_dev);
+      irq_dev.queue_rx();
+      run("irq", &irq_dev, packets,
+          [](unsigned num) { recv_irq(&irq_dev, num); });
+
+      static L4virtio::Driver::Virtio_net_poll_device poll_dev;
+      poll_dev.setup_device(ctx.poll_dev);
+      run("poll", &poll_dev, packets,
+          [](unsigned num) { recv_poll(&poll_dev, num); });
+    }
+  catch (L4::Runtime_error const &e)
+    {
+      fprintf(stderr, "net bench: %s: %s\n", e.str(), e.extra_str());
+      return 1;
+    }
+
+  return 0;
+}
@@ -28,6 +28,25 @@ typedef struct l4virtio_net_header_t
   l4_uint16_t num_buffers;
 } l4virtio_net_header_t;
 
+/** Flags in the header of a network request (l4virtio_net_header_t::flags). */
+enum L4virtio_net_header_flags
+{
+  /** Packet needs a checksum at csum_start + csum_offset. */
+  L4VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+  /** Checksum of the received packet has been validated. */
+  L4VIRTIO_NET_HDR_F_DATA_VALID = 2,
+};
+
+/** Segmentation types (l4virtio_net_header_t::gso_type). */
+enum L4virtio_net_header_gso_types
+{
+  L4VIRTIO_NET_HDR_GSO_NONE = 0,    /**< Not a GSO packet. */
+  L4VIRTIO_NET_HDR_GSO_TCPV4 = 1,   /**< TCP over IPv4 segmentation. */
+  L4VIRTIO_NET_HDR_GSO_UDP = 3,     /**< UDP fragmentation. */
+  L4VIRTIO_NET_HDR_GSO_TCPV6 = 4,   /**< TCP over IPv6 segmentation. */
+  L4VIRTIO_NET_HDR_GSO_ECN = 0x80,  /**< TCP segments have ECN CWR set. */
+};
+
 /**
  * Device configuration for network devices.
  */
@@ -66,4 +85,51 @@ enum L4virtio_net_feature_bits
   L4VIRTIO_NET_F_CTRL_MAC_ADDR = 23,
 };
 
+/**
+ * Header of a request on the control queue of a network device.
+ */
+typedef struct l4virtio_net_ctrl_header_t
+{
+  l4_uint8_t ctrl_class; /**< Command class, see L4virtio_net_ctrl_classes. */
+  l4_uint8_t cmd;        /**< Command within the class. */
+} l4virtio_net_ctrl_header_t;
+
+/** Command classes of the control queue. */
+enum L4virtio_net_ctrl_classes
+{
+  L4VIRTIO_NET_CTRL_RX = 0,    /**< Receive filtering, needs CTRL_RX. */
+  L4VIRTIO_NET_CTRL_MAC = 1,   /**< MAC address filtering. */
+  L4VIRTIO_NET_CTRL_VLAN = 2,  /**< VLAN filtering, needs CTRL_VLAN. */
+};
+
+/** Commands of the L4VIRTIO_NET_CTRL_RX class. */
+enum L4virtio_net_ctrl_rx_cmds
+{
+  L4VIRTIO_NET_CTRL_RX_PROMISC = 0,  /**< Enable/disable promiscuous mode. */
+  L4VIRTIO_NET_CTRL_RX_ALLMULTI = 1, /**< Enable/disable all-multicast. */
+};
+
+/** Commands of the L4VIRTIO_NET_CTRL_MAC class. */
+enum L4virtio_net_ctrl_mac_cmds
+{
+  /** Set unicast and multicast filter tables, needs CTRL_RX. */
+  L4VIRTIO_NET_CTRL_MAC_TABLE_SET = 0,
+  /** Set the default MAC address, needs CTRL_MAC_ADDR. */
+  L4VIRTIO_NET_CTRL_MAC_ADDR_SET = 1,
+};
+
+/** Commands of the L4VIRTIO_NET_CTRL_VLAN class. */
+enum L4virtio_net_ctrl_vlan_cmds
+{
+  L4VIRTIO_NET_CTRL_VLAN_ADD = 0, /**< Add a VLAN ID to the filter. */
+  L4VIRTIO_NET_CTRL_VLAN_DEL = 1, /**< Remove a VLAN ID from the filter. */
+};
+
+/** Status written by the device at the end of a control request. */
+enum L4virtio_net_ctrl_ack
+{
+  L4VIRTIO_NET_OK = 0,
+  L4VIRTIO_NET_ERR = 1,
+};
+
 /**\}*/